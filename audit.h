@@ -0,0 +1,218 @@
+// Allocation and syscall audit of the round loop (`make audit`, which builds
+// with -DBOXHUNT_AUDIT).
+//
+// Global operator new/delete are replaced to count allocations. read and
+// write syscalls are taken from the kernel's per-thread counters in
+// /proc/thread-self/io, so they include ones made from inside libc (stdio
+// flushes, for example), not just calls through the exported symbols. Counts
+// are taken on the game thread only, per phase of each round loop frame.
+// Frames that leave the steady state (pausing, ending a round) are skipped.
+// If a frame goes over the per-frame budget the game exits with status 1 and
+// a report, so a scripted run (e.g. `make audit-bench`) fails; otherwise the
+// report is printed on exit.
+//
+// Without BOXHUNT_AUDIT all of this compiles to nothing.
+#pragma once
+
+enum AuditPhase { AUDIT_UPDATE, AUDIT_INPUT, AUDIT_DRAW, AUDIT_PRESENT, AUDIT_PHASES };
+enum AuditCounter { AUDIT_ALLOCS, AUDIT_FREES, AUDIT_READS, AUDIT_WRITES, AUDIT_COUNTERS };
+
+#ifdef BOXHUNT_AUDIT
+#include <fcntl.h>
+#include <ncurses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <new>
+
+const char *audit_phase_names[AUDIT_PHASES] = {"update", "input", "draw", "present"};
+const char *audit_counter_names[AUDIT_COUNTERS] = {"allocs", "frees", "reads", "writes"};
+
+struct Audit {
+	bool inframe = false;
+	int phase = AUDIT_UPDATE;
+	// per frame, -1 for no limit. ncurses reads input a byte at a time, so a
+	// frame that takes a mouse report (~9 bytes each way) makes ~20 reads
+	long budget[AUDIT_COUNTERS] = {0, 0, 32, 1};
+	long frame[AUDIT_PHASES][AUDIT_COUNTERS] = {};
+	long total[AUDIT_PHASES][AUDIT_COUNTERS] = {};
+	long max[AUDIT_PHASES][AUDIT_COUNTERS] = {};
+	long frames = 0;
+	int iofd = -1;         // /proc/thread-self/io of the game thread
+	long syscr, syscw;     // its counters at the last sample
+} audit;
+
+thread_local bool audit_thread = false;  // set on the game thread
+
+inline void audit_count(int counter) {
+	if (audit_thread && audit.inframe)
+		audit.frame[audit.phase][counter]++;
+}
+
+void audit_report(FILE *f) {
+	fprintf(f, "audit: %ld frames, budget per frame:", audit.frames);
+	for (int c = 0; c < AUDIT_COUNTERS; c++)
+		fprintf(f, " %s=%ld", audit_counter_names[c], audit.budget[c]);
+	fprintf(f, "\n%-8s", "phase");
+	for (int c = 0; c < AUDIT_COUNTERS; c++)
+		fprintf(f, " %10s %6s", audit_counter_names[c], "max");
+	fprintf(f, "\n");
+	for (int p = 0; p < AUDIT_PHASES; p++) {
+		fprintf(f, "%-8s", audit_phase_names[p]);
+		for (int c = 0; c < AUDIT_COUNTERS; c++)
+			fprintf(f, " %10ld %6ld", audit.total[p][c], audit.max[p][c]);
+		fprintf(f, "\n");
+	}
+}
+
+void audit_exit() {
+	audit_thread = false;
+	audit_report(stderr);
+}
+
+// spec like "allocs=0,writes=2"
+bool audit_set_budget(const char *spec) {
+	while (*spec) {
+		int c;
+		for (c = 0; c < AUDIT_COUNTERS; c++) {
+			size_t n = strlen(audit_counter_names[c]);
+			if (strncmp(spec, audit_counter_names[c], n) == 0 && spec[n] == '=') {
+				spec += n + 1;
+				break;
+			}
+		}
+		if (c == AUDIT_COUNTERS)
+			return false;
+		char *end;
+		audit.budget[c] = strtol(spec, &end, 10);
+		if (end == spec || (*end && *end != ','))
+			return false;
+		spec = *end ? end + 1 : end;
+	}
+	return true;
+}
+
+long audit_field(const char *text, const char *name) {
+	const char *p = strstr(text, name);
+	return p ? atol(p + strlen(name)) : 0;
+}
+
+// charges the syscalls since the last sample to the current phase. The pread
+// doing the sampling is counted too, as one read in the next interval.
+void audit_sample(bool charge) {
+	char text[256];
+	ssize_t n = pread(audit.iofd, text, sizeof text - 1, 0);
+	if (n <= 0)
+		return;
+	text[n] = 0;
+	long syscr = audit_field(text, "syscr: "), syscw = audit_field(text, "syscw: ");
+	if (charge) {
+		audit.frame[audit.phase][AUDIT_READS] += syscr - audit.syscr - 1;
+		audit.frame[audit.phase][AUDIT_WRITES] += syscw - audit.syscw;
+	}
+	audit.syscr = syscr;
+	audit.syscw = syscw;
+}
+
+// call on the game thread
+void audit_start() {
+	audit.iofd = open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+	if (audit.iofd < 0) {
+		perror("audit: /proc/thread-self/io");
+		exit(1);
+	}
+	audit_thread = true;
+	atexit(audit_exit);
+}
+
+void audit_frame_begin() {
+	memset(audit.frame, 0, sizeof audit.frame);
+	audit.phase = AUDIT_UPDATE;
+	audit.inframe = true;
+	audit_sample(false);
+}
+
+void audit_phase(int phase) {
+	if (audit.inframe)
+		audit_sample(true);
+	audit.phase = phase;
+}
+
+// this frame isn't steady state: don't hold it to the budget
+void audit_skip_frame() {
+	audit.inframe = false;
+}
+
+void audit_frame_end() {
+	if (!audit.inframe)
+		return;
+	audit_sample(true);
+	audit.inframe = false;
+	audit.frames++;
+	bool over = false;
+	for (int c = 0; c < AUDIT_COUNTERS; c++) {
+		long sum = 0;
+		for (int p = 0; p < AUDIT_PHASES; p++) {
+			sum += audit.frame[p][c];
+			audit.total[p][c] += audit.frame[p][c];
+			if (audit.frame[p][c] > audit.max[p][c])
+				audit.max[p][c] = audit.frame[p][c];
+		}
+		if (audit.budget[c] >= 0 && sum > audit.budget[c])
+			over = true;
+	}
+	if (!over)
+		return;
+	audit_thread = false;
+	endwin();
+	fprintf(stderr, "audit: frame %ld over budget:", audit.frames);
+	for (int p = 0; p < AUDIT_PHASES; p++)
+		for (int c = 0; c < AUDIT_COUNTERS; c++)
+			if (audit.frame[p][c])
+				fprintf(stderr, " %s %s=%ld", audit_phase_names[p], audit_counter_names[c], audit.frame[p][c]);
+	fprintf(stderr, "\n");
+	audit_report(stderr);
+	_exit(1);
+}
+
+void *operator new(size_t size) {
+	audit_count(AUDIT_ALLOCS);
+	void *p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+	audit_count(AUDIT_ALLOCS);
+	return malloc(size ? size : 1);
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+	return operator new(size, std::nothrow);
+}
+void operator delete(void *p) noexcept {
+	if (p)
+		audit_count(AUDIT_FREES);
+	free(p);
+}
+void operator delete[](void *p) noexcept {
+	operator delete(p);
+}
+void operator delete(void *p, size_t) noexcept {
+	operator delete(p);
+}
+void operator delete[](void *p, size_t) noexcept {
+	operator delete(p);
+}
+
+#else
+inline bool audit_set_budget(const char *) { return false; }
+inline void audit_start() {}
+inline void audit_frame_begin() {}
+inline void audit_phase(int) {}
+inline void audit_skip_frame() {}
+inline void audit_frame_end() {}
+#endif
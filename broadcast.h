@@ -0,0 +1,178 @@
+// Spectator broadcast.
+//
+// Spectators connect to a Unix socket and get a keyframe (the whole screen)
+// followed by the cell diffs of every frame, as plain ANSI output, so
+// `nc -U PATH` in any terminal is a working client.
+//
+// The game thread only diffs curscr and appends to a shared buffer under a
+// mutex. A separate thread fans that buffer out to the clients, each with its
+// own bounded queue: a spectator that falls behind gets its queue replaced by
+// a fresh keyframe, and one that still isn't reading is dropped. Nothing a
+// spectator does can block the game.
+#pragma once
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "screen.h"
+
+const size_t BROADCAST_PENDING = 1 << 20;  // max unsent frame data (bytes)
+const size_t SPECTATOR_QUEUE = 64 << 10;   // max queued output per spectator
+const int BROADCAST_TICK = 16;             // ms between fan-outs
+const int MAX_SPECTATORS = 256;
+
+struct Spectator {
+	int fd;
+	std::string queue;
+	size_t sent = 0;
+	bool keyframe = false;  // the queue is an unsent keyframe
+};
+
+struct Broadcast {
+	VirtualScreen screen;   // game thread only
+	std::string delta;      // game thread only
+	std::mutex lock;        // guards pending, resync and cells
+	std::string pending;
+	bool resync = false;
+	std::vector<wchar_t> cells;
+	int listenfd = -1;
+	std::string path;
+
+	Broadcast(int lines, int cols) : screen(lines, cols), cells(lines * cols, L' ') {
+		// sized up front so capture() never allocates: a changed cell costs at
+		// most a cursor move and a UTF-8 character, and pending never grows
+		// past BROADCAST_PENDING (serve() swaps it with an equal buffer)
+		delta.reserve(lines * cols * 16);
+		pending.reserve(BROADCAST_PENDING);
+	}
+
+	// game thread: record what this frame changed
+	void capture() {
+		delta.clear();
+		if (!screen.capture(delta))
+			return;
+		std::lock_guard<std::mutex> guard(lock);
+		if (resync || pending.size() + delta.size() > BROADCAST_PENDING) {
+			// the fan-out thread is behind: everyone gets a keyframe instead
+			pending.clear();
+			resync = true;
+		} else {
+			pending += delta;
+		}
+		cells = screen.cells;
+	}
+
+	// returns false if the spectator has gone away
+	bool send_queue(Spectator &s) {
+		while (s.sent < s.queue.size()) {
+			ssize_t n = send(s.fd, s.queue.data() + s.sent, s.queue.size() - s.sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				break;
+			if (n <= 0)
+				return false;
+			s.sent += n;
+			s.keyframe = false;
+		}
+		if (s.sent == s.queue.size()) {
+			s.queue.clear();
+			s.sent = 0;
+		}
+		return true;
+	}
+
+	// fan-out thread
+	void serve() {
+		std::vector<Spectator> spectators;
+		VirtualScreen view(screen.lines, screen.cols);
+		std::string frames, keyframe;
+		frames.reserve(BROADCAST_PENDING);
+		std::vector<struct pollfd> fds;
+		for (;;) {
+			fds.assign(1, {listenfd, POLLIN, 0});
+			for (Spectator &s : spectators)
+				fds.push_back({s.fd, (short) (s.queue.empty() ? 0 : POLLOUT), 0});
+			poll(fds.data(), fds.size(), BROADCAST_TICK);
+
+			bool full;
+			frames.clear();
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				frames.swap(pending);
+				full = resync;
+				resync = false;
+				view.cells = cells;
+			}
+			keyframe.clear();
+			view.keyframe(keyframe);
+
+			for (size_t i = 0; i < spectators.size(); i++) {
+				Spectator &s = spectators[i];
+				bool alive = !(fds[i + 1].revents & (POLLERR | POLLHUP));
+				if (alive && (full || s.queue.size() + frames.size() > SPECTATOR_QUEUE)) {
+					if (s.keyframe && s.sent == 0) {
+						alive = false;  // hasn't taken anything since its last keyframe
+					} else {
+						// CAN aborts any escape sequence cut off in the old queue
+						s.queue = "\x18" + keyframe;
+						s.sent = 0;
+						s.keyframe = true;
+					}
+				} else {
+					s.queue += frames;
+				}
+				if (!alive || !send_queue(s)) {
+					close(s.fd);
+					s.fd = -1;
+				}
+			}
+			spectators.erase(std::remove_if(spectators.begin(), spectators.end(),
+				[](const Spectator &s) { return s.fd < 0; }), spectators.end());
+
+			// late joiners start from a keyframe
+			if (fds[0].revents & POLLIN) {
+				int fd;
+				while ((fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+					if (spectators.size() >= MAX_SPECTATORS) {
+						close(fd);
+						continue;
+					}
+					Spectator s;
+					s.fd = fd;
+					s.queue = keyframe;
+					s.keyframe = true;
+					if (send_queue(s))
+						spectators.push_back(s);
+					else
+						close(fd);
+				}
+			}
+		}
+	}
+
+	bool listen(const char *path1) {
+		struct sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		if (strlen(path1) >= sizeof addr.sun_path)
+			return false;
+		strcpy(addr.sun_path, path1);
+		listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (listenfd < 0)
+			return false;
+		unlink(path1);
+		if (bind(listenfd, (struct sockaddr *) &addr, sizeof addr) < 0 || ::listen(listenfd, 16) < 0) {
+			close(listenfd);
+			return false;
+		}
+		path = path1;
+		std::thread(&Broadcast::serve, this).detach();
+		return true;
+	}
+};
@@ -0,0 +1,36 @@
+// asciicast v2 export (https://docs.asciinema.org/manual/asciicast/v2/)
+#pragma once
+#include <stdio.h>
+#include <string>
+#include "screen.h"
+
+struct CastWriter {
+	FILE *out;
+	VirtualScreen screen;
+	std::string frame;
+	CastWriter(FILE *out1, int lines, int cols) : screen(lines, cols) {
+		out = out1;
+		fprintf(out, "{\"version\": 2, \"width\": %d, \"height\": %d, \"title\": \"box-hunt\"}\n", cols, lines);
+		frame.clear();
+		screen.keyframe(frame);
+		event(0);
+	}
+	// write a frame event at time t (us) if the screen has changed
+	void capture(long long t) {
+		frame.clear();
+		if (screen.capture(frame))
+			event(t);
+	}
+	void event(long long t) {
+		fprintf(out, "[%lld.%06lld, \"o\", \"", t / 1000000, t % 1000000);
+		for (unsigned char c : frame) {
+			if (c == '"' || c == '\\')
+				fprintf(out, "\\%c", c);
+			else if (c < 0x20)
+				fprintf(out, "\\u%04x", c);
+			else
+				fputc(c, out);
+		}
+		fputs("\"]\n", out);
+	}
+};
@@ -1,6 +1,8 @@
 #include <ncurses.h>
 #include <SDL/SDL_mixer.h>
 #include <stdlib.h>
+#include <string.h>
+#include <langinfo.h>
 #include <iostream>
 #include <chrono>
 #include <time.h>
@@ -9,17 +11,41 @@
 #include <tuple>
 #include <string>
 #include <memory>
-#include <map>
+#include "audit.h"
+#include "session.h"
+#include "cast.h"
+#include "metrics.h"
+#include "broadcast.h"
+#include "particles.h"
 
 const int MAX_COLUMNS = 54;
 const int MAX_LINES = 18;
 const int NANO = 1e9;
+const int ROUNDS = 5; // rounds (of two ducks) in each game round
 #define BLOCK L"\u2588"
 const float RAND = 5.0;
 
+// xorshift64* in place of rand(), so the rng state can go in snapshots
+const int RNG_MAX = 0x7fffffff;
+uint64_t rng = 1;
+void seed_rng(unsigned int seed) {
+	rng = (seed * 0x9E3779B97F4A7C15ULL) ^ 0x2545F4914F6CDD1DULL;
+	if (rng == 0)
+		rng = 1;
+}
+int next_rand() {
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return (int) ((rng * 0x2545F4914F6CDD1DULL) >> 33);
+}
+
+bool audio = true;
+
 class sample {
 public:
 	int channel;
+	int metric = -1;
     sample(const std::string &path, int volume, int channel);
     void play();
     void play(int times);
@@ -29,8 +55,8 @@ private:
     std::unique_ptr<Mix_Chunk, void (*)(Mix_Chunk *)> chunk;
 };
 sample::sample(const std::string &path, int volume, int channel)
-    : chunk(Mix_LoadWAV(path.c_str()), Mix_FreeChunk) {
-    if (!chunk.get()) {
+    : chunk(audio ? Mix_LoadWAV(path.c_str()) : NULL, Mix_FreeChunk) {
+    if (!chunk.get() && audio) {
 		std::cout << "Couldn't load sample\n" << SDL_GetError() << std::endl;
         // LOG("Couldn't load audio sample: ", path);
     }
@@ -38,19 +64,43 @@ sample::sample(const std::string &path, int volume, int channel)
     Mix_VolumeChunk(chunk.get(), volume);
 }
 void sample::play() {
+    if (!chunk)
+        return;
+    metrics_sound(metric);
     Mix_PlayChannel(this->channel, chunk.get(), 0);
 }
 void sample::play(int times) {
+    if (!chunk)
+        return;
+    metrics_sound(metric);
     Mix_PlayChannel(this->channel, chunk.get(), times - 1);
 }
 void sample::set_volume(int volume) {
+    if (!chunk)
+        return;
     Mix_VolumeChunk(chunk.get(), volume);
 }
 void sample::stop() {
+	if (!chunk)
+		return;
 	Mix_HaltChannel(this->channel);
 }
 
-std::map<std::string, sample*> sounds;
+enum Sound { DUCK_HIT, GUNSHOT1, GUNSHOT2, NOAMMO, HIHATLOOP, MENU1, MENU2, SUCCESS1, SUCCESS2, NUM_SOUNDS };
+const char *sound_names[NUM_SOUNDS] = {"duck_hit", "gunshot1", "gunshot2", "noammo", "hihatloop", "menu1", "menu2", "success1", "success2"};
+sample *sounds[NUM_SOUNDS];
+CastWriter *cast = NULL;
+Broadcast *broadcast = NULL;
+WINDOW *input = NULL;  // the round loop reads keys from here, see main
+
+// doupdate, and capture the frame when exporting or broadcasting
+void present() {
+	doupdate();
+	if (cast)
+		cast->capture(session.now);
+	if (broadcast)
+		broadcast->capture();
+}
 
 struct vec {
 	float mag;
@@ -81,7 +131,7 @@ std::tuple<float,float,int> attrGenerator(int r, int special) {
 
 std::vector<std::tuple<float, float, int>> attrList(int special, int offset) {
 	std::vector<std::tuple<float, float, int>> attrs;
-	for (int i=0; i<5; i++) {
+	for (int i=0; i<ROUNDS; i++) {
 		attrs.push_back(attrGenerator(i+offset, special)); 
 		attrs.push_back(attrGenerator(i+offset, special)); 
 	}
@@ -112,13 +162,12 @@ void setupGameOptions() {
 
 float randomfloat(float high, float low=0) {
 	//float x = static_cast <float> (rand()) / (static_cast <float> (RAND_MAX/high))+low;
-	float x = low + static_cast <float> (rand()) /( static_cast <float> (RAND_MAX/(high-low)));
+	float x = low + static_cast <float> (next_rand()) /( static_cast <float> (RNG_MAX/(high-low)));
 	return x;
 }
 
 struct PointCh {
 	std::wstring ch;
-	bool isgun = false;
 	bool visible = true;
 	float lifetime = 0;
 	float escapetime = -1; //time until escapes (sec)
@@ -130,14 +179,14 @@ struct PointCh {
 	PointCh(){}
 	PointCh(std::tuple<float,float,int> attr) {
 		float magnitude = randomfloat(std::get<0>(attr)+RAND, std::get<0>(attr)-RAND);
-		float angle = static_cast <float> (rand()) / (static_cast <float> (RAND_MAX/2.9))+0.1;
+		float angle = static_cast <float> (next_rand()) / (static_cast <float> (RNG_MAX/2.9))+0.1;
 		while (angle < 1.96 && angle > 1.17) //get rid of top pi/4 bc don't want ducks flying straight up and down
-			angle = static_cast <float> (rand()) / (static_cast <float> (RAND_MAX/2.9))+0.1;
+			angle = static_cast <float> (next_rand()) / (static_cast <float> (RNG_MAX/2.9))+0.1;
 		vect = vec(magnitude, angle);
 		
 		escapetime = std::get<1>(attr);
 		ch = L"\u25a1";
-		x = (rand() % MAX_COLUMNS) / 2;
+		x = (next_rand() % MAX_COLUMNS) / 2;
 		y = MAX_LINES;
 
 		if (std::get<2>(attr) == 1 || std::get<2>(attr) == 3) {
@@ -151,14 +200,12 @@ struct PointCh {
 		ch = ch1;
 	}
 	void update(float f) {
-		if (isgun)
-			return;
 		if (escapetime != -1 && lifetime > escapetime) {
 			escaped = true;
 		}
 		if (hit) {
 			if (y +r > MAX_LINES+2 && visible) {
-				sounds["duck_hit"]->play();
+				sounds[DUCK_HIT]->play();
 				visible = false;
 				return;
 			} else {
@@ -247,6 +294,7 @@ struct Scoreboard {
 		hit = hit1;
 		required = required1;
 		score = score1;
+		hitthisround = 0;
 	}
 	void draw(WINDOW *below, int gameround) {
 		mvwprintw(below, 1, 1, "           ");
@@ -270,22 +318,152 @@ struct Scoreboard {
 	}
 };
 
-bool intersecting(PointCh a, PointCh b) {
+// Everything needed to pick a game back up: written on pause and before each
+// round, and loaded at launch if present.
+struct GameState {
+	int gamemode = 0;              // index into Gamemodes
+	int gameround = 1;
+	int round = 0;                 // index into the gamemode's attrs
+	Scoreboard score = Scoreboard(0, 6, 0);
+	std::vector<PointCh> objects;  // the round in progress; empty between rounds
+};
+
+const char *snapshot_path = NULL;
+
+template <typename T> void put(std::string &out, const T &v) {
+	out.append((const char *) &v, sizeof v);
+}
+template <typename T> bool get(const char *&p, const char *end, T &v) {
+	if (end - p < (long) sizeof v)
+		return false;
+	memcpy(&v, p, sizeof v);
+	p += sizeof v;
+	return true;
+}
+
+void save_snapshot(const GameState &game) {
+	if (!snapshot_path)
+		return;
+	std::string out = "BHS3";
+	put(out, game.gamemode);
+	put(out, game.gameround);
+	put(out, game.round);
+	put(out, game.score.hit);
+	put(out, game.score.required);
+	put(out, game.score.hitthisround);
+	put(out, game.score.rounds);
+	put(out, game.score.score);
+	put(out, rng);
+	put(out, (uint8_t) game.objects.size());
+	for (const PointCh &o : game.objects) {
+		put(out, (uint8_t) (o.visible | o.escaped << 1 | o.hit << 2));
+		put(out, (uint32_t) o.ch[0]);
+		put(out, o.lifetime);
+		put(out, o.escapetime);
+		put(out, o.x);
+		put(out, o.y);
+		put(out, o.vect.mag);
+		put(out, o.vect.angle);
+		put(out, (int8_t) o.r);
+	}
+	// write then rename, so a dropped session never leaves half a snapshot.
+	// The temp file is per process, in case two games share the snapshot path
+	std::string tmp = std::string(snapshot_path) + "." + std::to_string(getpid()) + ".tmp";
+	FILE *f = fopen(tmp.c_str(), "wb");
+	if (!f)
+		return;
+	bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+	ok = fclose(f) == 0 && ok;
+	if (ok)
+		rename(tmp.c_str(), snapshot_path);
+	else
+		remove(tmp.c_str());
+}
+
+bool load_snapshot(GameState &game) {
+	char buf[512];
+	if (!snapshot_path)
+		return false;
+	FILE *f = fopen(snapshot_path, "rb");
+	if (!f)
+		return false;
+	size_t n = fread(buf, 1, sizeof buf, f);
+	fclose(f);
+	const char *p = buf + 4, *end = buf + n;
+	uint8_t count;
+	uint64_t state;
+	if (n < 4 || memcmp(buf, "BHS3", 4) != 0)
+		return false;
+	if (!(get(p, end, game.gamemode) && get(p, end, game.gameround) && get(p, end, game.round)
+			&& get(p, end, game.score.hit) && get(p, end, game.score.required)
+			&& get(p, end, game.score.hitthisround) && get(p, end, game.score.rounds)
+			&& get(p, end, game.score.score) && get(p, end, state) && get(p, end, count)))
+		return false;
+	if (game.gamemode < 0 || game.gamemode >= (int) Gamemodes.size() || game.gameround < 1
+			|| game.round < 0 || game.round >= ROUNDS || state == 0)
+		return false;
+	game.objects.clear();
+	for (int i = 0; i < count; i++) {
+		PointCh o;
+		uint8_t flags;
+		uint32_t ch;
+		int8_t r;
+		if (!(get(p, end, flags) && get(p, end, ch) && get(p, end, o.lifetime) && get(p, end, o.escapetime)
+				&& get(p, end, o.x) && get(p, end, o.y) && get(p, end, o.vect.mag)
+				&& get(p, end, o.vect.angle) && get(p, end, r)))
+			return false;
+		o.visible = flags & 1;
+		o.escaped = flags & 2;
+		o.hit = flags & 4;
+		o.ch = std::wstring(1, (wchar_t) ch);
+		o.r = r;
+		game.objects.push_back(o);
+	}
+	rng = state;
+	return true;
+}
+
+void remove_snapshot() {
+	if (snapshot_path)
+		remove(snapshot_path);
+}
+
+bool intersecting(const PointCh &a, const PointCh &b) {
 	if (fabs(a.x - b.x) <= 1 + fmax(a.r, b.r) && fabs(a.y - b.y) <= 1 + fmax(a.r, b.r)) {
 		return true;
 	}
 	return false;
 }
 
-void shoot_anim(WINDOW *win, PointCh *p, int x, int y) {
+Particles particles;
+
+void shoot_anim(PointCh *p, int x, int y) {
 	//mouse_trafo(&y, &x, true);
 	p->x = (float) x/2;
 	p->y = (float) y;
-	p->visible = true;
-	p->draw(win);
+	// flash over the same cells PointCh::draw would cover
+	for (int i = -p->r; i <= p->r; i++) {
+		for (int j = fmin(-(2*p->r), -1); j <= fmax(2*p->r, 1); j++) {
+			particles.spawn(2*((int) p->x) + j, (int) p->y + i, 0, 0, 1e-1, BLOCK[0], false, true);
+		}
+	}
 	return;
 }
 
+void hit_burst(PointCh *p) {
+	for (int i = 0; i < 10; i++) {
+		float angle = particles.random(2*M_PI);
+		float speed = particles.random(20, 8);
+		particles.spawn(2*p->x, p->y, 2*cos(angle)*speed, -sin(angle)*speed, particles.random(0.5, 0.25), i % 2 ? L'*' : L'+', true);
+	}
+}
+
+// bits coming off a falling duck, about 30 a second
+void debris(PointCh *p, float f) {
+	if (particles.random(1) < f / NANO * 30)
+		particles.spawn(2*p->x + particles.random(2, -2), p->y, particles.random(4, -4), particles.random(-5, -10), 0.6, L'\u2591', true);
+}
+
 void draw_borders(WINDOW *screen) { int x, y, i;
 	getmaxyx(screen, y, x);
 	// 4 corners
@@ -306,10 +484,10 @@ void draw_borders(WINDOW *screen) { int x, y, i;
 
 int kbhit(WINDOW * win)
 {
-    int ch = wgetch(win);
+    int ch = read_key(win);
 
     if (ch != ERR) {
-        ungetch(ch);
+        unread_key(ch);
         return 1;
     } else {
         return 0;
@@ -343,21 +521,21 @@ int changeOptions(WINDOW *optionsmenu, int * currentgamemode) {
 			mvwaddwstr(optionsmenu, optionscoord+1, 24, L" ");
 		}
 		wnoutrefresh(optionsmenu);
-		doupdate();
-		auto ch = wgetch(optionsmenu);
+		present();
+		auto ch = read_key(optionsmenu);
 		switch(ch) {
 			case KEY_UP: {
-				sounds["menu1"]->play();
+				sounds[MENU1]->play();
 				option -= option == 0 ? 0 : 1;
 				break;
 			}
 			case KEY_DOWN: {
-				sounds["menu1"]->play();
+				sounds[MENU1]->play();
 				option += option == numoptions-1 ? 0 : 1;
 				break;
 			}
 			case (int) ' ': {
-				sounds["menu2"]->play();
+				sounds[MENU2]->play();
 				switch (option) {
 					case 0: {
 						return 0;
@@ -367,13 +545,13 @@ int changeOptions(WINDOW *optionsmenu, int * currentgamemode) {
 				}
 			}
 			case KEY_LEFT: {
-				sounds["menu1"]->play();
+				sounds[MENU1]->play();
 				if (option == 1)
 					*currentgamemode -= *currentgamemode == 0 ? 0 : 1;
 				break;
 			}
 			case KEY_RIGHT: {
-				sounds["menu1"]->play();
+				sounds[MENU1]->play();
 				if (option == 1)
 					*currentgamemode += *currentgamemode == Gamemodes.size() - 1 ? 0 : 1;
 				break;
@@ -386,7 +564,7 @@ int changeOptions(WINDOW *optionsmenu, int * currentgamemode) {
 
 int playMenu(WINDOW *menu) {
 	int option = 0;
-	sounds["hihatloop"]->set_volume(0);
+	sounds[HIHATLOOP]->set_volume(0);
 	while (1) {
 		int numoptions = 2;
 		int optionscoord = 4;
@@ -400,21 +578,21 @@ int playMenu(WINDOW *menu) {
 		mvwprintw(menu, optionscoord+0, 13, "Resume");
 		mvwprintw(menu, optionscoord+1, 13, "Exit");
 		wnoutrefresh(menu);
-		doupdate();
-		auto ch1 = wgetch(menu);
+		present();
+		auto ch1 = read_key(menu);
 		switch (ch1) {
 			case KEY_UP: {
-				sounds["menu1"]->play();
+				sounds[MENU1]->play();
 				option -= option == 0 ? 0 : 1;
 				break;
 			}
 			case KEY_DOWN: {
-				sounds["menu1"]->play();
+				sounds[MENU1]->play();
 				option += option == numoptions-1 ? 0 : 1;
 				break;
 			}
 			case (int) ' ': { //spacebar
-				sounds["menu2"]->play();
+				sounds[MENU2]->play();
 				switch (option) {
 					case 0: {
 						goto resume;
@@ -426,7 +604,7 @@ int playMenu(WINDOW *menu) {
 				break;
 			}
 			case (int) 'p': {
-				sounds["menu2"]->play();
+				sounds[MENU2]->play();
 				goto resume;
 			}
 			default:
@@ -434,105 +612,120 @@ int playMenu(WINDOW *menu) {
 		}
 	}
 resume:
-	sounds["hihatloop"]->set_volume(30);
+	sounds[HIHATLOOP]->set_volume(30);
 	return 0;
 quit:
-	sounds["hihatloop"]->set_volume(30);
+	sounds[HIHATLOOP]->set_volume(30);
 	return 1;
 }
 
-int playRound(WINDOW *win, WINDOW *below, int round, Scoreboard *score, WINDOW * menu, GameOptions gamemode, int gameround) {
+int playRound(WINDOW *win, WINDOW *below, int round, Scoreboard *score, WINDOW * menu, const GameOptions &gamemode, int gameround, GameState &game) {
 	int k = 0;
 	//draw  initial borders
 	draw_borders(win);
 	draw_borders(below);
 	wnoutrefresh(win);
 	wnoutrefresh(below);
-	doupdate();
+	present();
 	//prepare game objects
 	std::vector<PointCh*> gameObjects;
-	for (int i=0; i<2; i++) {
-		PointCh* duck1 = new PointCh(gamemode.attrs[round]);
-		gameObjects.push_back(duck1);
+	if (game.objects.empty()) {
+		for (int i=0; i<2; i++) {
+			PointCh* duck1 = new PointCh(gamemode.attrs[round]);
+			gameObjects.push_back(duck1);
+		}
+		score->hitthisround = 0;
+		score->rounds =3;
+	} else {
+		// snapshot taken on pause: restore the round and pause again
+		for (int i=0; i<game.objects.size(); i++)
+			gameObjects.push_back(new PointCh(game.objects[i]));
+		game.objects.clear();
+		unread_key('p');
 	}
-	PointCh* gun = new PointCh(-5, -5, BLOCK);
-	gameObjects.push_back(gun);
-	gun->visible = false;
-	score->hitthisround = 0;
-	gun->r = gamemode.special == 2 || gamemode.special == 3 ? 0 : 1;
-	gun->isgun = true;
-	score->rounds =3;
+	PointCh gun(-5, -5, BLOCK); // where the last shot landed, for hit tests
+	gun.r = gamemode.special == 2 || gamemode.special == 3 ? 0 : 1;
+	particles.reset();
 	score->draw(below, gameround);
 	
 	//prepare time
-	auto t1 = std::chrono::system_clock::now();
-	auto t2 = std::chrono::system_clock::now();
+	long long t1 = game_clock();
+	long long t2 = t1;
 	float delta = -1;
 	
 	draw_borders(win);
 	draw_borders(below);
 	wnoutrefresh(win);
 	wnoutrefresh(below);
-	doupdate();
+	present();
 	//napms(rand() % 2000);
 	
-	sounds["hihatloop"]->play(0);
+	sounds[HIHATLOOP]->play(0);
 
 	while (1) {
+		audit_frame_begin();
 		// time between loops for consistent movement
-		t2 = std::chrono::system_clock::now();
-		delta = delta == -1 ? 0 : (t2 - t1).count();
+		t2 = game_clock();
+		delta = delta == -1 ? 0 : t2 - t1;
 		t1 = t2;
 
+		particles.clear(win);
 		for (int i=0; i<gameObjects.size(); i++) {
 			gameObjects[i]->redraw(win, delta);
 			gameObjects[i]->lifetime += gameObjects[i]->visible ? delta/NANO : 0;
+			if (gameObjects[i]->hit && gameObjects[i]->visible)
+				debris(gameObjects[i], delta);
 		}
+		particles.update(delta/NANO);
 		score->draw(below, gameround);
+		metrics_frame(delta, score->score, gameround);
 		//mvwprintw(win, 1, 1, "%f", gameObjects[0]->vect.mag);
 		//mvwprintw(win, 2, 20, "%f", gameObjects[1]->vect.mag);
-		//mvwprintw(win, 1, 1, "%f", gun->x);
-		//mvwprintw(win, 2, 1, "%f", gun->y);
-
-		if (gun->lifetime > 1e-1) { //gun flash effect
-			gun->clear(win);
-			gun->visible = false;
-			gun->x = -5; gun->y = -5; //move offscreen
-			gun->lifetime = 0;
-		}
-		if (kbhit(win)) {
-			auto ch = wgetch(win);
+		//mvwprintw(win, 1, 1, "%f", gun.x);
+		//mvwprintw(win, 2, 1, "%f", gun.y);
+
+		audit_phase(AUDIT_INPUT);
+		if (kbhit(input)) {
+			auto ch = read_key(input);
 			switch (ch) {
 				case KEY_MOUSE: {
 					MEVENT event;
-					if (getmouse(&event) == OK) {
+					if (read_mouse(&event) == OK) {
 						if (event.bstate & BUTTON1_PRESSED) {
 							if (score->rounds == 0) {
-								sounds["noammo"]->play();
+								sounds[NOAMMO]->play();
 								break;
 							}
 							score->rounds -= score->rounds == 0 ? 0 : 1; // decrement rounds
-							shoot_anim(win, gun, event.x, event.y);
+							shoot_anim(&gun, event.x, event.y);
 							if (gamemode.special == 2 || gamemode.special == 3)
-								sounds["gunshot2"]->play();
+								sounds[GUNSHOT2]->play();
 							else
-								sounds["gunshot1"]->play();
-							for (int i=0; i<gameObjects.size()-1; i++) { //check if gun hits any ducks
-								if (intersecting(*gun, *gameObjects[i]) && gameObjects[i]->hit == false) {
+								sounds[GUNSHOT1]->play();
+							int hits = score->hit;
+							for (int i=0; i<gameObjects.size(); i++) { //check if gun hits any ducks
+								if (intersecting(gun, *gameObjects[i]) && gameObjects[i]->hit == false) {
 									//mvwprintw(below, 1, 12, "HIT!");
 									gameObjects[i]->hit = true;
+									hit_burst(gameObjects[i]);
 									score->hit += 1;
 									score->hitthisround += 1;
 									//score increases by any value from 50 to 200 (rounded to 10s place) based on lifetime
 									score->score += (200 - (int) (150.0/gameObjects[i]->escapetime*gameObjects[i]->lifetime)) / 10 * 10;
 								}
 							}
+							metrics_shot(score->hit - hits);
 						}
 					}
 					break;
 								}
 				case (int) 'p': {//ESC key, pause
-					sounds["menu2"]->play();
+					audit_skip_frame();
+					sounds[MENU2]->play();
+					for (int i=0; i<gameObjects.size(); i++)
+						game.objects.push_back(*gameObjects[i]);
+					save_snapshot(game);
+					game.objects.clear();
 					k = playMenu(menu);
 					if (k) {
 						goto end;
@@ -542,22 +735,22 @@ int playRound(WINDOW *win, WINDOW *below, int round, Scoreboard *score, WINDOW *
 						 }
 				// allows a second player to control ducks with wasd
 				case (int) 'w' : {
-					for (int i=0; i<gameObjects.size()-1; i++)
+					for (int i=0; i<gameObjects.size(); i++)
 						gameObjects[i]->turn(0);
 					break;
 				}
 				case (int) 'a' : {
-					for (int i=0; i<gameObjects.size()-1; i++)
+					for (int i=0; i<gameObjects.size(); i++)
 						gameObjects[i]->turn(1);
 					break;
 				}
 				case (int) 's' : {
-					for (int i=0; i<gameObjects.size()-1; i++)
+					for (int i=0; i<gameObjects.size(); i++)
 						gameObjects[i]->turn(2);
 					break;
 				}
 				case (int) 'd' : {
-					for (int i=0; i<gameObjects.size()-1; i++)
+					for (int i=0; i<gameObjects.size(); i++)
 						gameObjects[i]->turn(3);
 					break;
 				}
@@ -571,17 +764,20 @@ int playRound(WINDOW *win, WINDOW *below, int round, Scoreboard *score, WINDOW *
 		}
 
 		//update screen
+		audit_phase(AUDIT_DRAW);
+		particles.draw(win);
 		draw_borders(win);
 		draw_borders(below);
 		wnoutrefresh(win);
 		wnoutrefresh(below);
-		doupdate();
+		audit_phase(AUDIT_PRESENT);
+		present();
 		if (score->hitthisround == 2)
-			sounds["hihatloop"]->stop();
+			sounds[HIHATLOOP]->stop();
 		
 		//check if game over
 		bool roundover = true;
-		for (int i=0; i<gameObjects.size()-1; i++) {
+		for (int i=0; i<gameObjects.size(); i++) {
 			if (!gameObjects[i]->visible) {
 				continue;
 			} else {
@@ -589,32 +785,37 @@ int playRound(WINDOW *win, WINDOW *below, int round, Scoreboard *score, WINDOW *
 			}
 		}
 		if (roundover) {
-			sounds["hihatloop"]->stop();
-			napms(600);
+			audit_skip_frame();
+			sounds[HIHATLOOP]->stop();
+			game_sleep(600);
 			if (score->hitthisround == 0) {
 				mvwprintw(win, 8, 20, "Great shots ;)");
 			} else {
 				mvwprintw(win, 7, 23, "Hit %d", score->hitthisround);
-				sounds["success1"]->play();
+				sounds[SUCCESS1]->play();
 			}
 			draw_borders(win);
 			draw_borders(below);
 			wnoutrefresh(win);
 			wnoutrefresh(below);
-			doupdate();
-			napms(1100);
+			present();
+			game_sleep(1100);
 			break;
 		}
+		audit_frame_end();
+		session_frame_end();
 	}
 	end:
-	sounds["hihatloop"]->stop();
+	for (int i=0; i<gameObjects.size(); i++)
+		delete gameObjects[i];
+	sounds[HIHATLOOP]->stop();
 	wclear(win);
 	wclear(below);
 	wclear(menu);
 	wnoutrefresh(win);
 	wnoutrefresh(below);
 	wnoutrefresh(menu);
-	doupdate();
+	present();
 	return k;
 }
 
@@ -631,39 +832,228 @@ void draw_title(WINDOW *mainmenu) {
 	mvwaddwstr(mainmenu, titley+7, titlex+0, L"                     |_| |_| \\__,_||_| |_| \\__|");
 }
 
-int main() {
+// plays from game (a new game or one loaded from a snapshot) until game over
+void playGame(GameState &game, WINDOW *win, WINDOW *below, WINDOW *menu) {
+	GameOptions gamemode = *Gamemodes[game.gamemode];
+	Scoreboard* score = &game.score;
+	if (game.objects.empty()) { // resuming mid-round goes straight to the pause menu
+		for (int i=3; i>0; i--) {
+			draw_borders(win);
+			mvwprintw(win, 8, 18, "Starting in %d", i);
+			wnoutrefresh(win);
+			present();
+			game_sleep(500);
+		}
+		mvwprintw(win, 8, 18, "             ");
+	}
+	for (; ; game.gameround++) {
+		int round = game.gameround;
+		gamemode.attrs = attrList(gamemode.special, (round-1)*ROUNDS);
+		for (; game.round < ROUNDS; ++game.round) {
+			if (game.objects.empty())
+				save_snapshot(game);
+			int k = playRound(win, below, game.round, score, menu, gamemode, round, game);
+			if (k) {
+				break;
+			}
+		}
+		game.round = 0;
+		int c = 8;
+		if (score->hit >= score->required) {
+			sounds[SUCCESS2]->play();
+			score->required += (round % 2 == 0 && score->required < 10) ? 1 : 0;
+			game_sleep(100);
+			draw_borders(win);
+			if (score->hit == 10) {
+				mvwprintw(win, c-1, 15, "Perfect round! +750");
+				score->score += 750;
+			}
+			score->hit = 0;
+			mvwprintw(win, c, 18, "Next round: %d", round+1);
+			mvwprintw(win, c+1, 13, "Press any key to continue");
+			wnoutrefresh(win);
+			present();
+			nodelay(win, FALSE);
+			read_key(win);
+			nodelay(win, TRUE);
+			mvwprintw(win, c-1, 15, "                     ");
+			mvwprintw(win, c, 18, "              ");
+			mvwprintw(win, c+1, 13, "                         ");
+			game_sleep(100);
+		} else {
+			// the game is over even if the player quits on this screen
+			remove_snapshot();
+			game_sleep(100);
+			draw_borders(win);
+			mvwprintw(win, c, 20, "Game Over");
+			mvwprintw(win, c+1, 19, "Score: %d", score->score);
+			if (score->score == 0)
+				mvwaddwstr(win, c+1, 26, L"\u2639");
+			mvwprintw(win, c+2, 13, "Press any key to continue");
+			wnoutrefresh(win);
+			present();
+			nodelay(win, FALSE);
+			read_key(win);
+			nodelay(win, TRUE);
+			mvwprintw(win, c, 16, "                ");
+			mvwprintw(win, c+1, 15, "                       ");
+			mvwprintw(win, c+2, 13, "                         ");
+			break;
+		}
+	}
+}
+
+// keeps the caller's locale if it's already UTF-8
+bool utf8_locale() {
+	const char *names[] = {"C.UTF-8", "C.utf8", "en_US.UTF-8"};
+	if (strcmp(nl_langinfo(CODESET), "UTF-8") == 0)
+		return true;
+	for (const char *name : names)
+		if (setlocale(LC_CTYPE, name) && strcmp(nl_langinfo(CODESET), "UTF-8") == 0)
+			return true;
+	return false;
+}
+
+void usage() {
+	std::cout << "usage: run [options]\n"
+	             "  --record SESSION         record inputs to SESSION while playing\n"
+	             "  --export SESSION CAST    replay SESSION into an asciicast file\n"
+	             "  --metrics                publish live metrics in /dev/shm/box-hunt.<pid>\n"
+	             "  --metrics-socket PATH    also serve them in Prometheus text format on PATH\n"
+	             "  --spectate PATH          broadcast the screen to spectators connecting to PATH\n"
+	             "  --particles N            draw at most N effect particles per frame (default 64)\n"
+	             "  --snapshot PATH          save/resume games at PATH (default ~/.box-hunt.snap)\n";
+#ifdef BOXHUNT_AUDIT
+	std::cout << "  --audit-budget SPEC      fail on a frame over SPEC (default allocs=0,frees=0,reads=32,writes=1)\n";
+#endif
+}
+
+int main(int argc, char **argv) {
 	setlocale(LC_ALL, "");
-	initscr();
+	const char *record = NULL, *replay = NULL, *castpath = NULL, *metricsocket = NULL, *spectate = NULL;
+	std::string snapshot = getenv("HOME") ? std::string(getenv("HOME")) + "/.box-hunt.snap" : ".box-hunt.snap";
+	bool publish = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--record" && i + 1 < argc) {
+			record = argv[++i];
+		} else if (arg == "--export" && i + 2 < argc) {
+			replay = argv[++i];
+			castpath = argv[++i];
+		} else if (arg == "--snapshot" && i + 1 < argc) {
+			snapshot = argv[++i];
+		} else if (arg == "--spectate" && i + 1 < argc) {
+			spectate = argv[++i];
+		} else if (arg == "--particles" && i + 1 < argc) {
+			particles.budget = atoi(argv[++i]);
+#ifdef BOXHUNT_AUDIT
+		} else if (arg == "--audit-budget" && i + 1 < argc) {
+			if (!audit_set_budget(argv[++i])) {
+				std::cout << "Bad budget " << argv[i] << " (e.g. allocs=0,reads=32,writes=1)\n";
+				return 1;
+			}
+#endif
+		} else if (arg == "--metrics") {
+			publish = true;
+		} else if (arg == "--metrics-socket" && i + 1 < argc) {
+			publish = true;
+			metricsocket = argv[++i];
+		} else {
+			usage();
+			return 1;
+		}
+	}
+	// recordings and replays always start from a new game
+	if (!record && !replay)
+		snapshot_path = snapshot.c_str();
+	if (record && !session_record(record)) {
+		std::cout << "Couldn't open " << record << " for recording\n";
+		return 1;
+	}
+	if (replay) {
+		if (!session_replay(replay)) {
+			std::cout << "Couldn't read session " << replay << "\n";
+			return 1;
+		}
+		FILE *out = fopen(castpath, "w");
+		if (!out) {
+			std::cout << "Couldn't open " << castpath << " for writing\n";
+			return 1;
+		}
+		// the cast is UTF-8, and ncurses decodes what's drawn with the locale
+		if (!utf8_locale()) {
+			std::cout << "Exporting needs a UTF-8 locale (e.g. C.UTF-8)\n";
+			return 1;
+		}
+		// no terminal or audio: the screen only exists inside ncurses
+		audio = false;
+		SCREEN *screen = newterm("xterm", fopen("/dev/null", "w"), fopen("/dev/null", "r"));
+		if (!screen) {
+			std::cout << "Exporting needs the xterm terminfo entry\n";
+			return 1;
+		}
+		set_term(screen);
+		resizeterm(MAX_LINES + 4, MAX_COLUMNS);
+		cast = new CastWriter(out, MAX_LINES + 4, MAX_COLUMNS);
+	} else if (publish) {
+		if (!metrics_open()) {
+			std::cout << "Couldn't create metrics segment\n";
+			return 1;
+		}
+		if (metricsocket && !metrics_listen(metricsocket)) {
+			std::cout << "Couldn't listen on " << metricsocket << "\n";
+			return 1;
+		}
+	}
+	if (spectate && !replay) {
+		broadcast = new Broadcast(MAX_LINES + 4, MAX_COLUMNS);
+		if (!broadcast->listen(spectate)) {
+			std::cout << "Couldn't listen on " << spectate << "\n";
+			return 1;
+		}
+		atexit([] { unlink(broadcast->path.c_str()); });
+	}
+	audit_start();
+	if (!replay)
+		initscr();
 	cbreak();
 	noecho();
 	curs_set(0);
 	mousemask(ALL_MOUSE_EVENTS, NULL);
 	mouseinterval(0);
-	srand(time(NULL));
+	// until it has been through endwin/refresh once, ncurses flushes after
+	// every cursor move, i.e. several write(2)s per frame
+	endwin();
+	refresh();
+	seed_rng(session_seed());
 
-	if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 1024) < 0) {
+	if (audio && Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 1024) < 0) {
     	endwin();
 		std::cout << "Error initializing SDL audio - make sure SDL2 and SDL2_mixer installed\n";
 		return 1;
-	} Mix_AllocateChannels(16);
+	} else if (audio) {
+		Mix_AllocateChannels(16);
+	}
 	sample duck_hit("audio/sfx_movement_jump13_landing.wav", 100, 0);
-	sounds["duck_hit"] = &duck_hit;
+	sounds[DUCK_HIT] = &duck_hit;
 	sample gunshot1("audio/sfx_weapon_shotgun1.wav", 60, 1);
-	sounds["gunshot1"] = &gunshot1;
+	sounds[GUNSHOT1] = &gunshot1;
 	sample gunshot2("audio/sfx_weapon_singleshot3.wav", 80, 2);
-	sounds["gunshot2"] = &gunshot2;
+	sounds[GUNSHOT2] = &gunshot2;
 	sample noammo("audio/sfx_wpn_noammo1.wav", 50, 3);
-	sounds["noammo"] = &noammo;
+	sounds[NOAMMO] = &noammo;
 	sample hihatloop("audio/KSHMR 128BPM Humanized Hat Loops 01.wav", 30, 4);
-	sounds["hihatloop"] = &hihatloop;
+	sounds[HIHATLOOP] = &hihatloop;
 	sample menu1("audio/sfx_menu_move1.wav", 50, 5);
-	sounds["menu1"] = &menu1;
+	sounds[MENU1] = &menu1;
 	sample menu2("audio/sfx_sounds_Blip4.wav", 50, 6);
-	sounds["menu2"] = &menu2;
+	sounds[MENU2] = &menu2;
 	sample success1("audio/KSHMR_Game_FX_29_Ready_Player_One.wav", 50, 7);
-	sounds["success1"] = &success1;
+	sounds[SUCCESS1] = &success1;
 	sample success2("audio/success.wav", 50, 8);
-	sounds["success2"] = &success2;
+	sounds[SUCCESS2] = &success2;
+	for (int i=0; i<NUM_SOUNDS; i++)
+		sounds[i]->metric = metrics_add_sound(sound_names[i]);
 
 	WINDOW * win = newwin(MAX_LINES, MAX_COLUMNS, 0, 0);
 	keypad(win, TRUE);
@@ -671,6 +1061,14 @@ int main() {
 
 	WINDOW * below = newwin(4, MAX_COLUMNS, MAX_LINES, 0);
 
+	// wgetch refreshes the window it reads from if it changed, and win changes
+	// every frame: reading from a window nothing draws on leaves present() as
+	// the frame's only flush
+	input = newwin(1, 1, 0, 0);
+	keypad(input, TRUE);
+	nodelay(input, TRUE);
+	untouchwin(input);
+
 	WINDOW * menu = newwin(MAX_LINES - 8, MAX_COLUMNS-20, 4, 10);
 	keypad(menu, TRUE);
 	
@@ -683,6 +1081,12 @@ int main() {
 	setupGameOptions();
 	int currentgamemode = 0;
 
+	GameState saved;
+	if (load_snapshot(saved)) {
+		currentgamemode = saved.gamemode;
+		playGame(saved, win, below, menu);
+	}
+
 	int option = 0;
 	int numoptions = 3;
 	int optionscoord = 12;
@@ -700,82 +1104,26 @@ int main() {
 		mvwaddwstr(mainmenu, optionscoord+1, xcoord+2, L"Options");
 		mvwaddwstr(mainmenu, optionscoord+2, xcoord+2, L"Quit");
 		wnoutrefresh(mainmenu);
-		doupdate();
-		auto ch = wgetch(mainmenu);
+		present();
+		auto ch = read_key(mainmenu);
 		switch (ch) {
 			case KEY_UP: {
 				option -= option == 0 ? 0 : 1;
-				sounds["menu1"]->play();
+				sounds[MENU1]->play();
 				break;
 						 }
 			case KEY_DOWN: {
 				option += option == numoptions-1 ? 0 : 1;
-				sounds["menu1"]->play();
+				sounds[MENU1]->play();
 				break;
 						 }
 			case (int) ' ': { //spacebar
-				sounds["menu2"]->play();
+				sounds[MENU2]->play();
 				switch (option) {
 					case 0: {
-						GameOptions gamemode = *Gamemodes[currentgamemode];
-						Scoreboard* score = new Scoreboard(0, 6, 0);
-						for (int i=3; i>0; i--) {
-							draw_borders(win);
-							mvwprintw(win, 8, 18, "Starting in %d", i);
-							wnoutrefresh(win);
-							doupdate();
-							napms(500);
-						}
-						mvwprintw(win, 8, 18, "             ");
-						for (int round = 1; ; round++) {
-							gamemode.attrs = attrList(gamemode.special, (round-1)*5);
-							for (int i=0; i < 5; ++i) {
-								int k = playRound(win, below, i, score, menu, gamemode, round);
-								if (k) {
-									break;
-								}
-							}
-							int c = 8;
-							if (score->hit >= score->required) {
-								sounds["success2"]->play();
-								score->required += (round % 2 == 0 && score->required < 10) ? 1 : 0;
-								napms(100);
-								draw_borders(win);
-								if (score->hit == 10) {
-									mvwprintw(win, c-1, 15, "Perfect round! +750");
-									score->score += 750;
-								}
-								score->hit = 0;
-								mvwprintw(win, c, 18, "Next round: %d", round+1);
-								mvwprintw(win, c+1, 13, "Press any key to continue");
-								wnoutrefresh(win);
-								doupdate();
-								nodelay(win, FALSE);
-								wgetch(win);
-								nodelay(win, TRUE);
-								mvwprintw(win, c-1, 15, "                     ");
-								mvwprintw(win, c, 18, "              ");
-								mvwprintw(win, c+1, 13, "                         ");
-								napms(100);
-							} else {
-								napms(100);
-								draw_borders(win);
-								mvwprintw(win, c, 20, "Game Over");
-								mvwprintw(win, c+1, 19, "Score: %d", score->score);
-								if (score->score == 0)
-									mvwaddwstr(win, c+1, 26, L"\u2639");
-								mvwprintw(win, c+2, 13, "Press any key to continue");
-								wnoutrefresh(win);
-								doupdate();
-								nodelay(win, FALSE);
-								wgetch(win);
-								nodelay(win, TRUE);
-								mvwprintw(win, c, 16, "                ");
-								mvwprintw(win, c+1, 15, "                       ");
-								mvwprintw(win, c+2, 13, "                         ");
-								break;
-							}
-						}
+						GameState game;
+						game.gamemode = currentgamemode;
+						playGame(game, win, below, menu);
 						break;
 					}
 					case 1: {
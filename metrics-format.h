@@ -0,0 +1,78 @@
+// Layout of the live metrics segment and how to read it, shared by the game
+// (metrics.h) and tools/metrics-reader.cpp.
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+
+const uint32_t METRICS_VERSION = 1;
+const int FRAME_BUCKETS = 12;  // bucket i: frame time < 2^i * 100us, last one unbounded
+const int MAX_SOUNDS = 16;
+
+struct Metrics {
+	std::atomic<uint32_t> seq;     // odd while an update is in progress
+	uint32_t version;
+	int32_t pid;
+	int32_t round;                 // latest game round played
+	int32_t score;
+	int32_t nsounds;
+	uint64_t frames;
+	uint64_t frametime[FRAME_BUCKETS];
+	uint64_t frametime_sum;        // ns
+	uint64_t shots;
+	uint64_t hits;
+	uint64_t bytes_written;        // to the terminal
+	char sound_names[MAX_SOUNDS][16];
+	uint64_t sound_plays[MAX_SOUNDS];
+};
+
+// Reader side: copy a consistent snapshot out of a live segment. Fails only
+// if the writer stays mid-update (i.e. it died in one).
+bool metrics_snapshot(const Metrics *shared, Metrics *out) {
+	for (int tries = 0; tries < 1000000; tries++) {
+		uint32_t s1 = shared->seq.load(std::memory_order_acquire);
+		if (s1 & 1)
+			continue;
+		memcpy((char *) out + sizeof out->seq, (const char *) shared + sizeof shared->seq,
+			sizeof(Metrics) - sizeof shared->seq);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (shared->seq.load(std::memory_order_relaxed) == s1)
+			return true;
+	}
+	return false;
+}
+
+double bucket_limit(int i) {
+	return (100e-6) * (1 << i);
+}
+
+std::string metrics_text(const Metrics &m) {
+	std::string out;
+	char buf[256];
+	auto line = [&](const char *fmt, auto... args) {
+		snprintf(buf, sizeof buf, fmt, args...);
+		out += buf;
+	};
+	line("# TYPE boxhunt_frames_total counter\nboxhunt_frames_total %llu\n", (unsigned long long) m.frames);
+	line("# TYPE boxhunt_frame_seconds histogram\n");
+	uint64_t cumulative = 0;
+	for (int i = 0; i < FRAME_BUCKETS - 1; i++) {
+		cumulative += m.frametime[i];
+		line("boxhunt_frame_seconds_bucket{le=\"%g\"} %llu\n", bucket_limit(i), (unsigned long long) cumulative);
+	}
+	line("boxhunt_frame_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long) m.frames);
+	line("boxhunt_frame_seconds_sum %.6f\n", m.frametime_sum / 1e9);
+	line("boxhunt_frame_seconds_count %llu\n", (unsigned long long) m.frames);
+	line("# TYPE boxhunt_shots_total counter\nboxhunt_shots_total %llu\n", (unsigned long long) m.shots);
+	line("# TYPE boxhunt_hits_total counter\nboxhunt_hits_total %llu\n", (unsigned long long) m.hits);
+	line("# TYPE boxhunt_round gauge\nboxhunt_round %d\n", m.round);
+	line("# TYPE boxhunt_score gauge\nboxhunt_score %d\n", m.score);
+	line("# TYPE boxhunt_sound_plays_total counter\n");
+	for (int i = 0; i < m.nsounds && i < MAX_SOUNDS; i++)
+		line("boxhunt_sound_plays_total{sound=\"%.16s\"} %llu\n", m.sound_names[i], (unsigned long long) m.sound_plays[i]);
+	line("# TYPE boxhunt_terminal_bytes_written_total counter\nboxhunt_terminal_bytes_written_total %llu\n",
+		(unsigned long long) m.bytes_written);
+	return out;
+}
@@ -0,0 +1,159 @@
+// Live session metrics.
+//
+// The game keeps its counters directly in a POSIX shared memory segment
+// (/dev/shm/box-hunt.<pid>) guarded by a seqlock: the game is the only writer
+// and never waits, readers retry if they raced with an update. Optionally the
+// same numbers are served in Prometheus text format on a Unix socket.
+#pragma once
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <new>
+#include <thread>
+#include "metrics-format.h"
+
+// Game side. Every update is bracketed by metrics_begin/metrics_end; with no
+// segment they're no-ops. Only the game thread may update the segment.
+Metrics *metrics = NULL;
+thread_local bool metrics_thread = false;
+char metrics_shm[32];
+std::string metrics_socket;
+
+void metrics_begin() {
+	metrics->seq.store(metrics->seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+void metrics_end() {
+	metrics->seq.store(metrics->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void metrics_close() {
+	shm_unlink(metrics_shm);
+	if (!metrics_socket.empty())
+		unlink(metrics_socket.c_str());
+}
+
+bool metrics_open() {
+	snprintf(metrics_shm, sizeof metrics_shm, "/box-hunt.%d", (int) getpid());
+	int fd = shm_open(metrics_shm, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+	if (ftruncate(fd, sizeof(Metrics)) < 0) {
+		close(fd);
+		shm_unlink(metrics_shm);
+		return false;
+	}
+	void *p = mmap(NULL, sizeof(Metrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		shm_unlink(metrics_shm);
+		return false;
+	}
+	metrics = new (p) Metrics();
+	metrics->version = METRICS_VERSION;
+	metrics->pid = getpid();
+	metrics_thread = true;
+	atexit(metrics_close);
+	return true;
+}
+
+int metrics_add_sound(const char *name) {
+	if (!metrics || metrics->nsounds == MAX_SOUNDS)
+		return -1;
+	metrics_begin();
+	int i = metrics->nsounds++;
+	strncpy(metrics->sound_names[i], name, sizeof metrics->sound_names[i]);
+	metrics_end();
+	return i;
+}
+
+void metrics_sound(int i) {
+	if (!metrics || i < 0)
+		return;
+	metrics_begin();
+	metrics->sound_plays[i]++;
+	metrics_end();
+}
+
+// one pass of the round loop, delta in ns
+void metrics_frame(float delta, int score, int round) {
+	if (!metrics)
+		return;
+	int bucket = 0;
+	while (bucket < FRAME_BUCKETS - 1 && delta >= bucket_limit(bucket) * 1e9)
+		bucket++;
+	metrics_begin();
+	metrics->frames++;
+	metrics->frametime[bucket]++;
+	metrics->frametime_sum += (uint64_t) delta;
+	metrics->score = score;
+	metrics->round = round;
+	metrics_end();
+}
+
+void metrics_shot(int hits) {
+	if (!metrics)
+		return;
+	metrics_begin();
+	metrics->shots++;
+	metrics->hits += hits;
+	metrics_end();
+}
+
+// ncurses flushes the screen with write(2) on the terminal's fd, so bytes
+// written are counted by interposing write: the executable's definition takes
+// precedence over libc's for calls from shared libraries. Writes from other
+// threads aren't counted, they'd race the game thread on the seqlock.
+extern "C" ssize_t write(int fd, const void *buf, size_t size) {
+	ssize_t n = syscall(SYS_write, fd, buf, size);
+	if (metrics && metrics_thread && fd == STDOUT_FILENO && n > 0) {
+		metrics_begin();
+		metrics->bytes_written += n;
+		metrics_end();
+	}
+	return n;
+}
+
+// serves one text snapshot per connection
+void metrics_serve(int fd) {
+	for (;;) {
+		int client = accept(fd, NULL, NULL);
+		if (client < 0)
+			continue;
+		Metrics m;
+		std::string text = metrics_snapshot(metrics, &m) ? metrics_text(m) : "";
+		const char *p = text.data();
+		size_t left = text.size();
+		while (left > 0) {
+			ssize_t n = write(client, p, left);
+			if (n <= 0)
+				break;
+			p += n;
+			left -= n;
+		}
+		close(client);
+	}
+}
+
+bool metrics_listen(const char *path) {
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof addr.sun_path)
+		return false;
+	strcpy(addr.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return false;
+	unlink(path);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof addr) < 0 || listen(fd, 8) < 0) {
+		close(fd);
+		return false;
+	}
+	metrics_socket = path;
+	std::thread(metrics_serve, fd).detach();
+	return true;
+}
@@ -0,0 +1,96 @@
+// Particle effects (gun flash, hit bursts, falling debris).
+//
+// Particles live in one fixed-size array, live ones first (dead ones are
+// swap-removed), and are updated and drawn in single passes, so effects never
+// allocate. Spawning into a full pool fails instead of growing it. At most
+// `budget` particles are drawn per frame: past that an even sample of them is
+// drawn instead, along with the ones that must always show (the gun flash).
+//
+// Effects draw from their own random generator, never the game's: that one is
+// saved in snapshots and replayed from recordings, and must not depend on the
+// frame rate or on how the effects look.
+#pragma once
+#include <ncurses.h>
+#include <stdint.h>
+
+const int MAX_PARTICLES = 512;
+const float GRAVITY = 40; // rows/s^2
+
+struct Particle {
+	float x, y;      // column, row
+	float vx, vy;    // per second
+	float age, ttl;  // seconds
+	wchar_t ch;
+	bool gravity;
+	bool always;     // drawn even when over budget
+};
+
+struct Particles {
+	Particle items[MAX_PARTICLES];
+	int count = 0;
+	int budget = 64;
+	int dropped = 0;  // spawns refused because the pool was full
+	short drawnx[MAX_PARTICLES], drawny[MAX_PARTICLES];
+	int ndrawn = 0;
+	uint64_t rng = 0x9E3779B97F4A7C15ULL;  // xorshift64*, effects only
+
+	void reset() {
+		count = 0;
+		ndrawn = 0;
+	}
+	// uniform in [low, high)
+	float random(float high, float low = 0) {
+		rng ^= rng >> 12;
+		rng ^= rng << 25;
+		rng ^= rng >> 27;
+		return low + (high - low) * ((rng * 0x2545F4914F6CDD1DULL) >> 40) / (float) (1 << 24);
+	}
+	bool spawn(float x, float y, float vx, float vy, float ttl, wchar_t ch, bool gravity = false, bool always = false) {
+		if (count == MAX_PARTICLES) {
+			dropped++;
+			return false;
+		}
+		items[count++] = {x, y, vx, vy, 0, ttl, ch, gravity, always};
+		return true;
+	}
+	// dt in seconds
+	void update(float dt) {
+		for (int i = 0; i < count; i++) {
+			Particle &p = items[i];
+			p.age += dt;
+			if (p.age > p.ttl) {
+				items[i--] = items[--count];
+				continue;
+			}
+			if (p.gravity)
+				p.vy += GRAVITY * dt;
+			p.x += p.vx * dt;
+			p.y += p.vy * dt;
+		}
+	}
+	// erase what the last draw put on screen
+	void clear(WINDOW *win) {
+		for (int i = 0; i < ndrawn; i++)
+			mvwaddch(win, drawny[i], drawnx[i], ' ');
+		ndrawn = 0;
+	}
+	void draw(WINDOW *win) {
+		int maxy, maxx;
+		getmaxyx(win, maxy, maxx);
+		int step = budget <= 0 ? 0 : (count + budget - 1) / budget;
+		int shown = 0;
+		for (int i = 0; i < count; i++) {
+			Particle &p = items[i];
+			if (!p.always && (step == 0 || i % step != 0 || shown >= budget))
+				continue;
+			int x = (int) p.x, y = (int) p.y;
+			if (x < 1 || x >= maxx - 1 || y < 1 || y >= maxy - 1)
+				continue;
+			mvwaddnwstr(win, y, x, &p.ch, 1);
+			drawnx[ndrawn] = x;
+			drawny[ndrawn] = y;
+			ndrawn++;
+			shown++;
+		}
+	}
+};
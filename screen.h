@@ -0,0 +1,80 @@
+// Virtual screen: a copy of what ncurses last put on the terminal, and the
+// minimal ANSI output needed to bring another terminal up to date with it.
+#pragma once
+#include <ncurses.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+void put_utf8(std::string &out, wchar_t c) {
+	unsigned int u = (unsigned int) c;
+	if (u < 0x80) {
+		out += (char) u;
+	} else if (u < 0x800) {
+		out += (char) (0xc0 | (u >> 6));
+		out += (char) (0x80 | (u & 0x3f));
+	} else if (u < 0x10000) {
+		out += (char) (0xe0 | (u >> 12));
+		out += (char) (0x80 | ((u >> 6) & 0x3f));
+		out += (char) (0x80 | (u & 0x3f));
+	} else {
+		out += (char) (0xf0 | (u >> 18));
+		out += (char) (0x80 | ((u >> 12) & 0x3f));
+		out += (char) (0x80 | ((u >> 6) & 0x3f));
+		out += (char) (0x80 | (u & 0x3f));
+	}
+}
+
+void put_cursor(std::string &out, int y, int x) {
+	char buf[32];
+	snprintf(buf, sizeof buf, "\x1b[%d;%dH", y + 1, x + 1);
+	out += buf;
+}
+
+struct VirtualScreen {
+	int lines, cols;
+	std::vector<wchar_t> cells;
+	std::vector<cchar_t> row;
+	VirtualScreen(int lines1, int cols1) : cells(lines1 * cols1, L' '), row(cols1 + 1) {
+		lines = lines1;
+		cols = cols1;
+	}
+	// read curscr into the copy, appending the output for any changed cells
+	// to out. Returns whether anything changed.
+	bool capture(std::string &out) {
+		size_t start = out.size();
+		for (int y = 0; y < lines; y++) {
+			int cx = -1; // cursor column if it's on this row
+			mvwin_wchnstr(curscr, y, 0, row.data(), cols);
+			for (int x = 0; x < cols; x++) {
+				wchar_t wc[CCHARW_MAX + 1];
+				attr_t attr;
+				short pair;
+				getcchar(&row[x], wc, &attr, &pair, NULL);
+				wchar_t c = wc[0] ? wc[0] : L' ';
+				if (cells[y*cols + x] == c)
+					continue;
+				cells[y*cols + x] = c;
+				if (cx >= 0 && x > cx && x - cx <= 4) {
+					// cheaper to rewrite a short unchanged gap than to move
+					for (int i = cx; i < x; i++)
+						put_utf8(out, cells[y*cols + i]);
+				} else if (cx != x) {
+					put_cursor(out, y, x);
+				}
+				put_utf8(out, c);
+				cx = x + 1;
+			}
+		}
+		return out.size() != start;
+	}
+	// output that draws the whole copy on a blank terminal
+	void keyframe(std::string &out) {
+		out += "\x1b[?25l\x1b[2J";
+		for (int y = 0; y < lines; y++) {
+			put_cursor(out, y, 0);
+			for (int x = 0; x < cols; x++)
+				put_utf8(out, cells[y*cols + x]);
+		}
+	}
+};
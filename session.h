@@ -0,0 +1,218 @@
+// Session recording and replay.
+//
+// Every source of nondeterminism the game reads (the rng seed, the clock and
+// keyboard/mouse input) goes through the functions below. In RECORD mode each
+// value is appended to a compact log; in REPLAY mode the same values are read
+// back from the log instead, so the game logic runs exactly as it did live but
+// without a terminal and without waiting on real time.
+//
+// Log format: "BHR1", varint seed, then a stream of entries
+//   'c' dt                      clock read
+//   'k' dt key                  key read (key zigzag encoded, ERR included)
+//   'm' dt ok x y bstate        getmouse result (x, y zigzag encoded)
+// where dt is microseconds since the previous entry.
+#pragma once
+#include <ncurses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+
+enum SessionMode { LIVE, RECORD, REPLAY };
+
+const long long FRAME_PACE = 4000; // min frame time while recording (us)
+
+struct Session {
+	int mode = LIVE;
+	FILE *log = NULL;
+	long long now = 0;        // session time (us)
+	long long last = 0;       // time of the last logged entry (us)
+	long long frameend = 0;   // time the previous frame finished (us)
+	int pending = ERR;        // key pushed back by unread_key
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+} session;
+
+void put_varint(uint64_t v) {
+	while (v >= 0x80) {
+		fputc((int) (v & 0x7f) | 0x80, session.log);
+		v >>= 7;
+	}
+	fputc((int) v, session.log);
+}
+
+// the replay has run out of input: that's the end of the session
+void session_end() {
+	endwin();
+	exit(0);
+}
+
+uint64_t get_varint() {
+	uint64_t v = 0;
+	for (int shift = 0; ; shift += 7) {
+		int c = fgetc(session.log);
+		if (c == EOF)
+			session_end();
+		v |= (uint64_t) (c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return v;
+	}
+}
+
+uint64_t zigzag(long long v) { return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63); }
+long long unzigzag(uint64_t v) { return (long long) (v >> 1) ^ -(long long) (v & 1); }
+
+long long wall_clock() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - session.start).count();
+}
+
+// start an entry: the tag and the time elapsed since the previous one
+void put_entry(char tag) {
+	long long t = wall_clock();
+	fputc(tag, session.log);
+	put_varint(t - session.last);
+	session.last = session.now = t;
+}
+
+// read the next entry, which must have the given tag
+void get_entry(char tag) {
+	int c = fgetc(session.log);
+	if (c == EOF)
+		session_end();
+	if (c != tag) {
+		endwin();
+		fprintf(stderr, "Session log out of sync (expected '%c', got '%c')\n", tag, c);
+		exit(1);
+	}
+	session.last += get_varint();
+	session.now = session.last;
+}
+
+bool session_record(const char *path) {
+	session.log = fopen(path, "wb");
+	if (!session.log)
+		return false;
+	session.mode = RECORD;
+	fwrite("BHR1", 1, 4, session.log);
+	return true;
+}
+
+bool session_replay(const char *path) {
+	char magic[4];
+	session.log = fopen(path, "rb");
+	if (!session.log)
+		return false;
+	if (fread(magic, 1, 4, session.log) != 4 || memcmp(magic, "BHR1", 4) != 0) {
+		fclose(session.log);
+		session.log = NULL;
+		return false;
+	}
+	session.mode = REPLAY;
+	return true;
+}
+
+unsigned int session_seed() {
+	switch (session.mode) {
+		case RECORD: {
+			unsigned int seed = time(NULL);
+			put_varint(seed);
+			return seed;
+		}
+		case REPLAY:
+			return (unsigned int) get_varint();
+		default:
+			return time(NULL);
+	}
+}
+
+// current session time in nanoseconds
+long long game_clock() {
+	switch (session.mode) {
+		case RECORD:
+			put_entry('c');
+			break;
+		case REPLAY:
+			get_entry('c');
+			break;
+		default:
+			session.now = wall_clock();
+			break;
+	}
+	return session.now * 1000;
+}
+
+void game_sleep(int ms) {
+	if (session.mode == REPLAY)
+		session.now += ms * 1000LL;
+	else
+		napms(ms);
+}
+
+// wgetch through the session log
+int read_key(WINDOW *win) {
+	int ch;
+	if (session.pending != ERR) {
+		ch = session.pending;
+		session.pending = ERR;
+		return ch;
+	}
+	switch (session.mode) {
+		case RECORD:
+			ch = wgetch(win);
+			put_entry('k');
+			put_varint(zigzag(ch));
+			if (ch != ERR)
+				fflush(session.log);
+			return ch;
+		case REPLAY:
+			// wgetch refreshes the window before reading
+			if (is_wintouched(win))
+				wrefresh(win);
+			get_entry('k');
+			return (int) unzigzag(get_varint());
+		default:
+			return wgetch(win);
+	}
+}
+
+void unread_key(int ch) {
+	session.pending = ch;
+}
+
+// getmouse through the session log
+int read_mouse(MEVENT *event) {
+	int ok;
+	switch (session.mode) {
+		case RECORD:
+			ok = getmouse(event);
+			put_entry('m');
+			put_varint(ok == OK);
+			put_varint(zigzag(event->x));
+			put_varint(zigzag(event->y));
+			put_varint(event->bstate);
+			return ok;
+		case REPLAY:
+			get_entry('m');
+			ok = get_varint() ? OK : ERR;
+			event->id = 0;
+			event->x = (int) unzigzag(get_varint());
+			event->y = (int) unzigzag(get_varint());
+			event->z = 0;
+			event->bstate = (mmask_t) get_varint();
+			return ok;
+		default:
+			return getmouse(event);
+	}
+}
+
+// keeps recordings to a bounded size by capping the frame rate while recording
+void session_frame_end() {
+	if (session.mode != RECORD)
+		return;
+	long long t = wall_clock();
+	if (t - session.frameend < FRAME_PACE)
+		napms((int) ((FRAME_PACE - (t - session.frameend) + 999) / 1000));
+	session.frameend = wall_clock();
+}
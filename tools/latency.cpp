@@ -0,0 +1,502 @@
+// End-to-end latency benchmark.
+//
+// Runs the game on a pseudo-terminal, drives it through the menus and a few
+// rounds, and measures how long it takes from writing an input to the pty
+// until its effect shows up in the game's output:
+//   click     mouse press -> gun flash (BLOCK) at the click position
+//   options   arrow key in the options menu -> menu redrawn
+//   pause     arrow key in the pause menu -> menu redrawn
+// The first round is left to play out after one shot at a duck, which takes
+// ten seconds or so.
+//
+// The output stream is fed through a small xterm emulator, so no real
+// terminal is needed (this runs fine in CI). At the end the game is quit
+// from its menus and must exit with status 0, so a failing audit build
+// (see audit.h) fails the run.
+//
+// usage: latency [-n clicks] [-m menu presses] [path to run]
+#include <pty.h>
+#include <locale.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+const int LINES = 24;
+const int COLS = 80;
+const wchar_t BLOCK = L'█';
+const wchar_t ARROW = L'▸';
+const wchar_t ROUND = L'▎';
+const wchar_t DUCK = L'□';
+const int TIMEOUT = 2000; // ms
+
+// just enough of xterm to follow what ncurses draws
+struct Terminal {
+	wchar_t cells[LINES][COLS];
+	int y = 0, x = 0;
+	int savey = 0, savex = 0;
+	wchar_t last = L' ';
+	int state = 0; // 0 text, 1 ESC, 2 CSI, 3 OSC, 4 charset
+	std::string params;
+	unsigned int utf8 = 0;
+	int utf8left = 0;
+
+	Terminal() { erase(0, 0, LINES - 1, COLS - 1); }
+
+	void erase(int y1, int x1, int y2, int x2) {
+		for (int i = y1; i <= y2; i++)
+			for (int j = (i == y1 ? x1 : 0); j <= (i == y2 ? x2 : COLS - 1); j++)
+				cells[i][j] = L' ';
+	}
+	void scroll() {
+		memmove(cells[0], cells[1], sizeof(cells[0]) * (LINES - 1));
+		erase(LINES - 1, 0, LINES - 1, COLS - 1);
+	}
+	void put(wchar_t c) {
+		if (x >= COLS) {
+			x = 0;
+			if (++y >= LINES) {
+				y = LINES - 1;
+				scroll();
+			}
+		}
+		cells[y][x++] = c;
+		last = c;
+	}
+	void clamp() {
+		y = std::max(0, std::min(y, LINES - 1));
+		x = std::max(0, std::min(x, COLS - 1));
+	}
+	int param(int i, int def) {
+		int n = 0;
+		const char *p = params.c_str();
+		if (*p == '?')
+			p++;
+		for (; n < i && *p; p++)
+			if (*p == ';')
+				n++;
+		if (n < i || !isdigit(*p))
+			return def;
+		int v = atoi(p);
+		return v == 0 ? def : v;
+	}
+	void csi(char f) {
+		int n = param(0, 1);
+		switch (f) {
+			case 'H': case 'f':
+				y = param(0, 1) - 1;
+				x = param(1, 1) - 1;
+				break;
+			case 'A': y -= n; break;
+			case 'B': y += n; break;
+			case 'C': x += n; break;
+			case 'D': x -= n; break;
+			case 'G': x = n - 1; break;
+			case 'd': y = n - 1; break;
+			case 'b':
+				for (int i = 0; i < n; i++)
+					put(last);
+				return;
+			case 'J': {
+				int mode = param(0, 0);
+				if (mode == 0)
+					erase(y, x, LINES - 1, COLS - 1);
+				else if (mode == 1)
+					erase(0, 0, y, x);
+				else
+					erase(0, 0, LINES - 1, COLS - 1);
+				break;
+			}
+			case 'K': {
+				int mode = param(0, 0);
+				if (mode == 0)
+					erase(y, x, y, COLS - 1);
+				else if (mode == 1)
+					erase(y, 0, y, x);
+				else
+					erase(y, 0, y, COLS - 1);
+				break;
+			}
+			case 'X':
+				erase(y, x, y, std::min(x + n - 1, COLS - 1));
+				break;
+			case 'P':
+				n = std::min(n, COLS - x);
+				memmove(&cells[y][x], &cells[y][x + n], sizeof(wchar_t) * (COLS - x - n));
+				erase(y, COLS - n, y, COLS - 1);
+				break;
+			case '@':
+				n = std::min(n, COLS - x);
+				memmove(&cells[y][x + n], &cells[y][x], sizeof(wchar_t) * (COLS - x - n));
+				erase(y, x, y, x + n - 1);
+				break;
+			case 'L':
+				n = std::min(n, LINES - y);
+				memmove(cells[y + n], cells[y], sizeof(cells[0]) * (LINES - y - n));
+				erase(y, 0, y + n - 1, COLS - 1);
+				break;
+			case 'M':
+				n = std::min(n, LINES - y);
+				memmove(cells[y], cells[y + n], sizeof(cells[0]) * (LINES - y - n));
+				erase(LINES - n, 0, LINES - 1, COLS - 1);
+				break;
+			default: // modes, attributes, scroll regions: no effect on content
+				return;
+		}
+		clamp();
+	}
+	void feed(const char *buf, size_t len) {
+		for (size_t i = 0; i < len; i++) {
+			unsigned char c = buf[i];
+			switch (state) {
+				case 1: // ESC
+					state = 0;
+					if (c == '[') {
+						state = 2;
+						params.clear();
+					} else if (c == ']') {
+						state = 3;
+					} else if (c == '(' || c == ')') {
+						state = 4;
+					} else if (c == '7') {
+						savey = y; savex = x;
+					} else if (c == '8') {
+						y = savey; x = savex;
+					} else if (c == 'M') {
+						y -= y == 0 ? 0 : 1;
+					} else if (c == 'E') {
+						x = 0;
+						y++;
+						clamp();
+					}
+					continue;
+				case 2: // CSI
+					if (c >= 0x40 && c <= 0x7e) {
+						state = 0;
+						csi(c);
+					} else {
+						params += c;
+					}
+					continue;
+				case 3: // OSC, ends with BEL or ST
+					if (c == 7 || c == '\\')
+						state = 0;
+					continue;
+				case 4: // charset designation
+					state = 0;
+					continue;
+			}
+			if (utf8left) {
+				utf8 = (utf8 << 6) | (c & 0x3f);
+				if (--utf8left == 0)
+					put((wchar_t) utf8);
+				continue;
+			}
+			if (c >= 0xf0) { utf8 = c & 0x07; utf8left = 3; }
+			else if (c >= 0xe0) { utf8 = c & 0x0f; utf8left = 2; }
+			else if (c >= 0xc0) { utf8 = c & 0x1f; utf8left = 1; }
+			else if (c == 0x1b) state = 1;
+			else if (c == '\r') x = 0;
+			else if (c == '\n') { if (++y >= LINES) { y = LINES - 1; scroll(); } }
+			else if (c == '\b') x -= x == 0 ? 0 : 1;
+			else if (c == '\t') x = std::min((x / 8 + 1) * 8, COLS - 1);
+			else if (c >= 0x20 && c < 0x7f) put(c);
+		}
+	}
+	void dump(FILE *f) {
+		for (int i = 0; i < LINES; i++) {
+			std::string line;
+			for (int j = 0; j < COLS; j++) {
+				char buf[8];
+				int n = wctomb(buf, cells[i][j]);
+				line.append(buf, n > 0 ? n : 0);
+			}
+			fprintf(f, "%s\n", line.c_str());
+		}
+	}
+	bool text(int y1, int x1, const char *s) {
+		for (int i = 0; s[i]; i++)
+			if (x1 + i >= COLS || cells[y1][x1 + i] != (wchar_t) s[i])
+				return false;
+		return true;
+	}
+};
+
+typedef std::function<bool(Terminal &)> Predicate;
+
+int master = -1;
+pid_t child = -1;
+char snapshot[64]; // keeps the game from resuming, or leaving behind, a saved game
+Terminal term;
+
+double elapsed_ms(std::chrono::steady_clock::time_point since) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+// reaps the game; "" if it exited with status 0
+std::string exit_status() {
+	int status;
+	char buf[64] = "";
+	if (waitpid(child, &status, 0) < 0)
+		snprintf(buf, sizeof buf, "lost track of it");
+	else if (WIFSIGNALED(status))
+		snprintf(buf, sizeof buf, "signal %d", WTERMSIG(status));
+	else if (WEXITSTATUS(status) != 0)
+		snprintf(buf, sizeof buf, "status %d", WEXITSTATUS(status));
+	return buf;
+}
+
+// read game output until pred holds; returns ms since start, or -1 on timeout
+double wait_for(Predicate pred, std::chrono::steady_clock::time_point start, int timeout = TIMEOUT) {
+	char buf[4096];
+	while (!pred(term)) {
+		int left = timeout - (int) elapsed_ms(start);
+		if (left <= 0)
+			return -1;
+		struct pollfd pfd = {master, POLLIN, 0};
+		if (poll(&pfd, 1, left) <= 0)
+			continue;
+		ssize_t n = read(master, buf, sizeof buf);
+		if (n <= 0) {
+			fprintf(stderr, "game exited early (%s)\n", exit_status().c_str());
+			remove(snapshot);
+			exit(1);
+		}
+		term.feed(buf, n);
+	}
+	return elapsed_ms(start);
+}
+
+void send(const std::string &s) {
+	if (write(master, s.data(), s.size()) != (ssize_t) s.size()) {
+		perror("write");
+		exit(1);
+	}
+}
+
+// send input and time how long until pred holds
+double measure(const std::string &input, Predicate pred) {
+	auto start = std::chrono::steady_clock::now();
+	send(input);
+	return wait_for(pred, start);
+}
+
+void require(Predicate pred, const char *what, int timeout = TIMEOUT) {
+	if (wait_for(pred, std::chrono::steady_clock::now(), timeout) < 0) {
+		fprintf(stderr, "timed out waiting for %s, screen was:\n", what);
+		term.dump(stderr);
+		kill(child, SIGKILL);
+		remove(snapshot);
+		exit(1);
+	}
+}
+
+Predicate at(int y, int x, wchar_t c) {
+	return [=](Terminal &t) { return t.cells[y][x] == c; };
+}
+Predicate not_at(int y, int x, wchar_t c) {
+	return [=](Terminal &t) { return t.cells[y][x] != c; };
+}
+Predicate text(int y, int x, const char *s) {
+	return [=](Terminal &t) { return t.text(y, x, s); };
+}
+// the whole redraw must have arrived, not just its first half
+Predicate both(Predicate a, Predicate b) {
+	return [=](Terminal &t) { return a(t) && b(t); };
+}
+
+const std::string KEY_UP = "\x1bOA";
+const std::string KEY_DOWN = "\x1bOB";
+const std::string KEY_LEFT = "\x1bOD";
+const std::string KEY_RIGHT = "\x1bOC";
+
+// SGR (1006) mouse report, as xterm sends with TERM=xterm
+std::string mouse(int y, int x, bool press) {
+	char buf[32];
+	snprintf(buf, sizeof buf, "\x1b[<0;%d;%d%c", x + 1, y + 1, press ? 'M' : 'm');
+	return buf;
+}
+
+struct Samples {
+	const char *name;
+	std::vector<double> ms;
+	int timeouts = 0;
+	void add(double v) {
+		if (v < 0)
+			timeouts++;
+		else
+			ms.push_back(v);
+	}
+	void report() {
+		if (ms.empty()) {
+			printf("%-8s  no samples (%d timeouts)\n", name, timeouts);
+			return;
+		}
+		std::sort(ms.begin(), ms.end());
+		double sum = 0;
+		for (double v : ms)
+			sum += v;
+		auto pct = [&](double p) { return ms[std::min(ms.size() - 1, (size_t) (p * ms.size()))]; };
+		printf("%-8s %5zu %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %5d\n", name, ms.size(),
+			ms.front(), pct(0.5), pct(0.9), pct(0.99), ms.back(), sum / ms.size(), timeouts);
+	}
+};
+
+// screen coordinates (the menus are windows at row 4, column 10)
+const int MENU_Y = 4 + 4, MENU_X = 10 + 11;
+const int MAIN_Y = 12, MAIN_X = 20;
+const int BELOW_Y = 18;
+const int FIELD_LINES = 18, FIELD_COLS = 54;  // the play window, at 0,0
+
+int main(int argc, char **argv) {
+	setlocale(LC_ALL, "");
+	int clicks = 30, presses = 20;
+	const char *game = "./run";
+	int opt;
+	while ((opt = getopt(argc, argv, "n:m:")) != -1) {
+		if (opt == 'n')
+			clicks = atoi(optarg);
+		else if (opt == 'm')
+			presses = atoi(optarg);
+		else {
+			fprintf(stderr, "usage: %s [-n clicks] [-m menu presses] [path to run]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		game = argv[optind];
+
+	snprintf(snapshot, sizeof snapshot, "/tmp/box-hunt-latency.%d.snap", (int) getpid());
+	remove(snapshot);
+	struct winsize ws = {LINES, COLS, 0, 0};
+	int errfd = dup(STDERR_FILENO);
+	child = forkpty(&master, NULL, NULL, &ws);
+	if (child < 0) {
+		perror("forkpty");
+		return 1;
+	}
+	if (child == 0) {
+		setenv("TERM", "xterm", 1);
+		setenv("LC_ALL", "C.UTF-8", 1); // the emulator only speaks UTF-8
+		setenv("SDL_AUDIODRIVER", "dummy", 0);
+		// the game's stderr (e.g. an audit report) goes to ours, not the pty
+		dup2(errfd, STDERR_FILENO);
+		execl(game, game, "--snapshot", snapshot, (char *) NULL);
+		perror(game);
+		_exit(127);
+	}
+
+	Samples click = {"click"}, options = {"options"}, pause = {"pause"};
+
+	// main menu -> options
+	require(text(MAIN_Y, MAIN_X + 2, "Play"), "main menu");
+	require(at(MAIN_Y, MAIN_X, ARROW), "main menu cursor");
+	send(KEY_DOWN);
+	require(at(MAIN_Y + 1, MAIN_X, ARROW), "main menu cursor");
+	send(" ");
+	require(text(MENU_Y, MENU_X + 2, "Back"), "options menu");
+	for (int i = 0; i < presses; i++) {
+		// the gamemode line shows its own arrows once selected
+		options.add(measure(KEY_DOWN, both(at(MENU_Y + 1, MENU_X + 13, ARROW), not_at(MENU_Y, MENU_X, ARROW))));
+		options.add(measure(KEY_RIGHT, both(text(MENU_Y + 1, MENU_X + 2, "Shotgun "), at(MENU_Y + 1, MENU_X, L'◂'))));
+		options.add(measure(KEY_LEFT, both(text(MENU_Y + 1, MENU_X + 2, "Standard"), not_at(MENU_Y + 1, MENU_X, L'◂'))));
+		options.add(measure(KEY_UP, both(at(MENU_Y, MENU_X, ARROW), not_at(MENU_Y + 1, MENU_X + 13, ARROW))));
+	}
+	send(" ");
+	require([](Terminal &t) { return !t.text(MENU_Y, MENU_X + 2, "Back"); }, "main menu");
+	send(KEY_UP);
+	require(at(MAIN_Y, MAIN_X, ARROW), "main menu cursor");
+
+	// play: each round has three shots, then a trip to the pause menu, then
+	// '-' skips to the next round
+	send(" ");
+	auto round_started = at(BELOW_Y + 1, 11, ROUND);
+	require(round_started, "first round", 5000);
+
+	// the first round plays out with a single shot, at a duck, so the frames
+	// where ducks fly, fall (shedding debris) and escape all run at least once
+	int duck_y = 0, duck_x = 0;
+	require([&](Terminal &t) {
+		for (int y = 1; y < FIELD_LINES - 1; y++)
+			for (int x = 1; x < FIELD_COLS - 1; x++)
+				if (t.cells[y][x] == DUCK) {
+					duck_y = y;
+					duck_x = x;
+					return true;
+				}
+		return false;
+	}, "a duck");
+	send(mouse(duck_y, duck_x, true));
+	require(both(at(duck_y, duck_x, BLOCK), [&](Terminal &t) { return !round_started(t); }), "the shot");
+	send(mouse(duck_y, duck_x, false));
+	require(round_started, "second round", 20000);
+	for (int shot = 0; click.ms.size() + click.timeouts < (size_t) clicks; shot++) {
+		if (shot > 0 && shot % 3 == 0) {
+			send("p");
+			require(text(MENU_Y, MENU_X + 2, "Resume"), "pause menu");
+			for (int i = 0; i < presses / 4 + 1; i++) {
+				pause.add(measure(KEY_DOWN, both(at(MENU_Y + 1, MENU_X, ARROW), not_at(MENU_Y, MENU_X, ARROW))));
+				pause.add(measure(KEY_UP, both(at(MENU_Y, MENU_X, ARROW), not_at(MENU_Y + 1, MENU_X, ARROW))));
+			}
+			send("p");
+			send("-");
+			// after five rounds the game waits on a key (next round / game over)
+			require([&](Terminal &t) { return round_started(t) || t.text(9, 13, "Press any key") || t.text(10, 13, "Press any key"); },
+				"next round", 5000);
+			if (!round_started(term)) {
+				bool gameover = term.text(8, 20, "Game Over");
+				send(" ");
+				if (gameover) {
+					require(text(MAIN_Y, MAIN_X + 2, "Play"), "main menu");
+					send(" ");
+				}
+				require(round_started, "next round", 5000);
+			}
+		}
+		// spread shots over the field, on even columns so the flash is centred
+		int y = 3 + (shot * 5) % 12;
+		int x = 2 * (3 + (shot * 7) % 22);
+		require(not_at(y, x, BLOCK), "previous flash to clear");
+		auto start = std::chrono::steady_clock::now();
+		send(mouse(y, x, true));
+		click.add(wait_for(at(y, x, BLOCK), start));
+		send(mouse(y, x, false));
+	}
+
+	// leave through the pause and main menus, so the game exits normally
+	send("p");
+	require(text(MENU_Y, MENU_X + 2, "Resume"), "pause menu");
+	send(KEY_DOWN);
+	require(at(MENU_Y + 1, MENU_X, ARROW), "pause menu cursor");
+	send(" ");
+	require(text(8, 20, "Game Over"), "game over");
+	send(" ");
+	require(text(MAIN_Y, MAIN_X + 2, "Play"), "main menu");
+	send(KEY_DOWN);
+	send(KEY_DOWN);
+	require(at(MAIN_Y + 2, MAIN_X, ARROW), "main menu cursor");
+	send(" ");
+	char buf[4096];
+	while (read(master, buf, sizeof buf) > 0)
+		;
+	std::string status = exit_status();
+	remove(snapshot);
+
+	printf("%-8s %5s %8s %8s %8s %8s %8s %8s %5s\n", "ms", "n", "min", "p50", "p90", "p99", "max", "mean", "lost");
+	click.report();
+	options.report();
+	pause.report();
+	if (!status.empty()) {
+		fprintf(stderr, "game failed on exit (%s)\n", status.c_str());
+		return 1;
+	}
+	return click.ms.empty() ? 1 : 0;
+}
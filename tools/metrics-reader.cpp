@@ -0,0 +1,70 @@
+// Prints the live metrics of running games in Prometheus text format.
+//
+// usage: metrics-reader [-i seconds] [pid...]
+// With no pids, reads every /dev/shm/box-hunt.* segment.
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <vector>
+#include "../metrics-format.h"
+
+bool print(int pid) {
+	char name[32];
+	snprintf(name, sizeof name, "/box-hunt.%d", pid);
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "no metrics for pid %d\n", pid);
+		return false;
+	}
+	void *p = mmap(NULL, sizeof(Metrics), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return false;
+	const Metrics *shared = (const Metrics *) p;
+	Metrics m;
+	bool ok = shared->version == METRICS_VERSION && metrics_snapshot(shared, &m);
+	munmap(p, sizeof(Metrics));
+	if (!ok) {
+		fprintf(stderr, "unreadable metrics for pid %d\n", pid);
+		return false;
+	}
+	printf("# pid %d%s\n%s", pid, kill(pid, 0) == 0 ? "" : " (not running)", metrics_text(m).c_str());
+	return true;
+}
+
+int main(int argc, char **argv) {
+	int interval = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "i:")) != -1) {
+		if (opt == 'i') {
+			interval = atoi(optarg);
+		} else {
+			fprintf(stderr, "usage: %s [-i seconds] [pid...]\n", argv[0]);
+			return 1;
+		}
+	}
+	for (;;) {
+		std::vector<int> pids;
+		for (int i = optind; i < argc; i++)
+			pids.push_back(atoi(argv[i]));
+		if (optind == argc) {
+			DIR *dir = opendir("/dev/shm");
+			struct dirent *e;
+			while (dir && (e = readdir(dir)))
+				if (strncmp(e->d_name, "box-hunt.", 9) == 0)
+					pids.push_back(atoi(e->d_name + 9));
+			if (dir)
+				closedir(dir);
+		}
+		bool ok = !pids.empty();
+		for (int pid : pids)
+			ok = print(pid) && ok;
+		fflush(stdout);
+		if (!interval)
+			return ok ? 0 : 1;
+		sleep(interval);
+	}
+}